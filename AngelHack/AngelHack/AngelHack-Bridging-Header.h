@@ -8,3 +8,4 @@
 #import "ChirpSDK.framework/Headers/ChirpErrors.h"
 #import "ChirpSDK.framework/Headers/ChirpSDK.h"
 #import "ChirpSDK.framework/Headers/AudioAlertPlayer.h"
+#import "ChirpAtomic.h"
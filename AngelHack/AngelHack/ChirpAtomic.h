@@ -0,0 +1,24 @@
+//
+//  ChirpAtomic.h
+//  AngelHack
+//
+//  Acquire/release accessors for counters shared between the audio thread
+//  and background queues. Swift 3 has no atomics of its own.
+//
+
+#ifndef ChirpAtomic_h
+#define ChirpAtomic_h
+
+#include <stdint.h>
+
+static inline int64_t ChirpAtomicLoadAcquire(const int64_t *value)
+{
+    return __atomic_load_n(value, __ATOMIC_ACQUIRE);
+}
+
+static inline void ChirpAtomicStoreRelease(int64_t *value, int64_t newValue)
+{
+    __atomic_store_n(value, newValue, __ATOMIC_RELEASE);
+}
+
+#endif /* ChirpAtomic_h */
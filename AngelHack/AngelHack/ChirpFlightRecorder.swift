@@ -0,0 +1,537 @@
+//
+//  ChirpFlightRecorder.swift
+//  AngelHack
+//
+//  Keeps the last few seconds of captured audio in a fixed ring and dumps it,
+//  together with the receive counters, when a chirp fails to decode. The
+//  same ring can also be drained continuously to disk.
+//
+
+import Foundation
+import AudioToolbox
+
+class ChirpFlightRecorder {
+    enum Trigger {
+        case decodeFailure
+        case hearFailed
+        case manual
+    }
+
+    var triggers: Set<Trigger> = [.decodeFailure, .hearFailed, .manual]
+
+    // A decode failure is reported both to the heard block and as
+    // hear.failed; automatic triggers within this many seconds of the last
+    // dump are treated as the same failure. Manual triggers always dump.
+    var holdoff: TimeInterval = 2.0
+
+    // Each dump is about 2 bytes per sample of audio plus its diagnostics;
+    // only this many of the most recent are kept.
+    var maxDumps = 20
+
+    let sampleRate: Double
+    let capacity: Int
+
+    // Written only from the audio thread. The ring is preallocated so that
+    // append() never allocates; a dump copies out of it on dumpQueue.
+    // `written` counts samples appended so far and is published with release
+    // semantics after the ring stores, so a reader that loads it with
+    // acquire semantics never sees samples that are not there yet.
+    private let ring: UnsafeMutablePointer<Int16>
+    private let written: UnsafeMutablePointer<Int64>
+    private var appendTicks: UInt64 = 0
+    private var appendCount: UInt64 = 0
+
+    private let dumpQueue = DispatchQueue(label: "io.chirp.angelhack.flightrecorder", qos: .utility)
+    private var observer: NSObjectProtocol?
+    private var lastAutomaticDump: TimeInterval = -Double.infinity
+    private var dumpSequence = 0
+
+    // Continuous recording; set these before startRecording(to:).
+    var compressRecording = false
+    var maxWritesInFlight = 4
+    var drainInterval: TimeInterval = 0.5
+    private var recordChannel: DispatchIO?
+    private var recordTimer: DispatchSourceTimer?
+    private var recordCompletion: (() -> Void)?
+    private var drained = 0
+    private var recordOffset: off_t = 0
+    private var writesInFlight = 0
+    private var lastRecordedSample: Int16 = 0
+    private var recordStartedAt: TimeInterval = 0
+    private var recordStoppedAt: TimeInterval?
+    private var completedBytes = 0
+    private var droppedSamples = 0
+
+    // Upper bound on the frames in one audio buffer, used as slack when
+    // checking whether a drain raced the audio thread.
+    private let maxBufferFrames = 4096
+
+    init(seconds: Double, sampleRate: Double) {
+        precondition(seconds > 0 && sampleRate > 0)
+        self.sampleRate = sampleRate
+        capacity = Int(seconds * sampleRate)
+        ring = UnsafeMutablePointer<Int16>.allocate(capacity: capacity)
+        ring.initialize(to: 0, count: capacity)
+        written = UnsafeMutablePointer<Int64>.allocate(capacity: 1)
+        written.initialize(to: 0)
+
+        observer = NotificationCenter.default.addObserver(forName: Notification.Name(rawValue: ChirpNotificationAudioHearFailed), object: nil, queue: nil) { [weak self] _ in
+            self?.trigger(.hearFailed)
+        }
+    }
+
+    deinit {
+        if let observer = observer {
+            NotificationCenter.default.removeObserver(observer)
+        }
+        ring.deinitialize(count: capacity)
+        ring.deallocate(capacity: capacity)
+        written.deinitialize()
+        written.deallocate(capacity: 1)
+    }
+
+    // Install on the SDK's audio buffer block. Samples are stored as int16
+    // whether the SDK delivers float or int16 audio. The SDK header
+    // describes the buffer as both mono and "256 frames of stereo audio",
+    // so interleaved channels are averaged down to mono. The sample format
+    // is inferred from the bytes per sample once channels are accounted
+    // for; anything other than Float32 or int16 is skipped.
+    func append(_ buffer: UnsafeMutablePointer<AudioBuffer>, numFrames: UInt32) {
+        let channels = Int(buffer.pointee.mNumberChannels)
+        guard let data = buffer.pointee.mData, numFrames > 0, channels > 0 else {
+            return
+        }
+        let start = mach_absolute_time()
+        let frames = Int(numFrames)
+        let bytesPerSample = Int(buffer.pointee.mDataByteSize) / (frames * channels)
+        let total = written.pointee
+        var index = Int(total) % capacity
+
+        if (bytesPerSample == MemoryLayout<Float>.size) {
+            let samples = data.assumingMemoryBound(to: Float.self)
+            for i in 0..<frames {
+                var sum: Float = 0
+                for c in 0..<channels {
+                    sum += samples[i * channels + c]
+                }
+                let sample = max(-1.0, min(1.0, sum / Float(channels)))
+                ring[index] = Int16(sample * Float(Int16.max))
+                index = (index + 1 == capacity) ? 0 : index + 1
+            }
+        } else if (bytesPerSample == MemoryLayout<Int16>.size) {
+            let samples = data.assumingMemoryBound(to: Int16.self)
+            for i in 0..<frames {
+                var sum: Int32 = 0
+                for c in 0..<channels {
+                    sum += Int32(samples[i * channels + c])
+                }
+                ring[index] = Int16(sum / Int32(channels))
+                index = (index + 1 == capacity) ? 0 : index + 1
+            }
+        } else {
+            return
+        }
+
+        ChirpAtomicStoreRelease(written, total + Int64(frames))
+        appendTicks += mach_absolute_time() - start
+        appendCount += 1
+    }
+
+    // Mean time spent in append() per audio buffer, in nanoseconds.
+    func averageAppendCost() -> Double {
+        guard appendCount > 0 else {
+            return 0
+        }
+        var timebase = mach_timebase_info_data_t()
+        mach_timebase_info(&timebase)
+        return Double(appendTicks) * Double(timebase.numer) / Double(timebase.denom) / Double(appendCount)
+    }
+
+    // Call from the chirp heard block.
+    func recordHeard(error: Error?) {
+        if let error = error as NSError?, error.code == ChirpError.decodeFailed.rawValue {
+            trigger(.decodeFailure)
+        }
+    }
+
+    func trigger(_ reason: Trigger) {
+        guard triggers.contains(reason) else {
+            return
+        }
+
+        // Only the end position is captured on the calling thread, which
+        // for hear.failed may be an SDK thread; the copy and the file
+        // writes happen on dumpQueue.
+        let end = Int(ChirpAtomicLoadAcquire(written))
+        let now = ProcessInfo.processInfo.systemUptime
+        dumpQueue.async {
+            if (reason != .manual) {
+                if (now - self.lastAutomaticDump < self.holdoff) {
+                    return
+                }
+                self.lastAutomaticDump = now
+            }
+            self.write(samples: self.copyRing(end: end), diagnostics: self.diagnostics(reason: reason))
+        }
+    }
+
+    // The audio thread keeps writing while this copies, so the oldest few
+    // samples of a dump may already have been overwritten. That is
+    // acceptable for diagnostics and keeps the capture path lock-free.
+    func copyRing(end: Int) -> [Int16] {
+        let count = min(end, capacity)
+        var samples = [Int16](repeating: 0, count: count)
+        let first = (end - count) % capacity
+        let head = min(count, capacity - first)
+        for i in 0..<head {
+            samples[i] = ring[first + i]
+        }
+        for i in head..<count {
+            samples[i] = ring[i - head]
+        }
+        return samples
+    }
+
+    private func diagnostics(reason: Trigger) -> [String: Any] {
+        let stats = ChirpStats.shared.snapshot()
+        return [
+            "reason": String(describing: reason),
+            "date": Date().description,
+            "sample_rate": sampleRate,
+            "hear_started": stats.hearStarted,
+            "hear_complete": stats.hearComplete,
+            "hear_failed": stats.hearFailed,
+            "chirps_heard": stats.chirpsHeard,
+            "decode_failures": stats.decodeFailures,
+            "other_errors": stats.otherErrors,
+            "duplicates_heard": stats.duplicatesHeard,
+            "active_receptions": stats.activeReceptions,
+            "append_ns": averageAppendCost(),
+        ]
+    }
+
+    private func write(samples: [Int16], diagnostics: [String: Any]) {
+        let fileManager = FileManager.default
+        guard let documents = fileManager.urls(for: .documentDirectory, in: .userDomainMask).first else {
+            return
+        }
+        let directory = documents.appendingPathComponent("flightrecorder", isDirectory: true)
+        dumpSequence += 1
+        let name = "\(Int(Date().timeIntervalSince1970 * 1000))-\(dumpSequence)"
+
+        do {
+            try fileManager.createDirectory(at: directory, withIntermediateDirectories: true, attributes: nil)
+            try wav(samples: samples).write(to: directory.appendingPathComponent(name + ".wav"))
+            let json = try JSONSerialization.data(withJSONObject: diagnostics, options: .prettyPrinted)
+            try json.write(to: directory.appendingPathComponent(name + ".json"))
+        } catch {
+            print(error.localizedDescription)
+        }
+        pruneDumps(in: directory)
+    }
+
+    // Deletes the oldest dumps, with their diagnostics, beyond maxDumps.
+    // Names start with a millisecond timestamp, so they sort oldest first.
+    private func pruneDumps(in directory: URL) {
+        let fileManager = FileManager.default
+        guard let files = try? fileManager.contentsOfDirectory(at: directory, includingPropertiesForKeys: nil, options: []) else {
+            return
+        }
+        let dumps = files.filter { $0.pathExtension == "wav" }.sorted { $0.lastPathComponent < $1.lastPathComponent }
+        guard dumps.count > maxDumps else {
+            return
+        }
+        for dump in dumps.prefix(dumps.count - maxDumps) {
+            try? fileManager.removeItem(at: dump)
+            try? fileManager.removeItem(at: dump.deletingPathExtension().appendingPathExtension("json"))
+        }
+    }
+
+    // MARK: Continuous recording
+
+    // Drains the ring to `url` every drainInterval seconds, off the audio
+    // thread, as raw 16-bit mono PCM or, with compressRecording,
+    // delta-encoded varints (each delta is against the previous recorded
+    // sample, starting from zero). While maxWritesInFlight writes are
+    // outstanding the drain waits for the next tick; samples are only lost
+    // if it falls (nearly) a full ring behind and the audio thread
+    // overwrites them first. Lost samples are counted and replaced by
+    // silence so the file keeps its length.
+    func startRecording(to url: URL) {
+        dumpQueue.async {
+            guard self.recordChannel == nil else {
+                return
+            }
+            let channel = DispatchIO(type: .stream, path: url.path, oflag: O_WRONLY | O_CREAT | O_TRUNC, mode: 0o644, queue: self.dumpQueue) { error in
+                if (error != 0) {
+                    print("recording closed with error \(error)")
+                }
+                self.recordStoppedAt = ProcessInfo.processInfo.systemUptime
+                self.recordCompletion?()
+                self.recordCompletion = nil
+            }
+            self.recordChannel = channel
+            self.drained = Int(ChirpAtomicLoadAcquire(self.written))
+            self.recordOffset = 0
+            self.lastRecordedSample = 0
+            self.completedBytes = 0
+            self.droppedSamples = 0
+            self.recordStartedAt = ProcessInfo.processInfo.systemUptime
+            self.recordStoppedAt = nil
+
+            let timer = DispatchSource.makeTimerSource(queue: self.dumpQueue)
+            timer.scheduleRepeating(deadline: .now() + self.drainInterval, interval: self.drainInterval)
+            timer.setEventHandler { self.drain() }
+            timer.resume()
+            self.recordTimer = timer
+        }
+    }
+
+    // `completion` runs on the recorder's queue once every queued write has
+    // completed and the file is closed.
+    func stopRecording(completion: (() -> Void)? = nil) {
+        dumpQueue.async {
+            guard self.recordChannel != nil else {
+                completion?()
+                return
+            }
+            self.recordTimer?.cancel()
+            self.recordTimer = nil
+            self.drain(force: true)
+            self.recordCompletion = completion
+            self.recordChannel?.close()
+            self.recordChannel = nil
+        }
+    }
+
+    // Bytes the kernel has completed writing, per second of wall-clock time
+    // since recording started (or until it stopped), and samples lost to
+    // ring overruns.
+    func recordingStats() -> (bytesPerSecond: Double, completedBytes: Int, droppedSamples: Int) {
+        return dumpQueue.sync { () -> (bytesPerSecond: Double, completedBytes: Int, droppedSamples: Int) in
+            let end = recordStoppedAt ?? ProcessInfo.processInfo.systemUptime
+            let elapsed = end - recordStartedAt
+            let rate = elapsed > 0 ? Double(completedBytes) / elapsed : 0
+            return (bytesPerSecond: rate, completedBytes: completedBytes, droppedSamples: droppedSamples)
+        }
+    }
+
+    private func drain(force: Bool = false) {
+        guard let channel = recordChannel else {
+            return
+        }
+        // Pending samples stay in the ring until the next tick rather than
+        // being dropped; only a final drain on stop ignores the limit.
+        if (writesInFlight >= maxWritesInFlight && !force) {
+            return
+        }
+
+        let end = Int(ChirpAtomicLoadAcquire(written))
+        var gap = 0
+        if (end - drained > capacity) {
+            gap = end - drained - capacity
+            drained = end - capacity
+        }
+        let count = gap + end - drained
+        guard count > 0 else {
+            return
+        }
+
+        // One buffer for the whole drain, filled with at most two copies
+        // out of the ring. calloc leaves the gap as silence.
+        let samples = calloc(count, MemoryLayout<Int16>.size)!.assumingMemoryBound(to: Int16.self)
+        let first = drained % capacity
+        let head = min(end - drained, capacity - first)
+        memcpy(samples + gap, ring + first, head * MemoryLayout<Int16>.size)
+        memcpy(samples + gap + head, ring, (end - drained - head) * MemoryLayout<Int16>.size)
+
+        // The audio thread kept writing during the copy, so anything a full
+        // ring behind the new end, or behind a buffer it may be storing but
+        // has not yet published, may have been overwritten. Those samples
+        // are replaced with silence and counted as dropped.
+        let oldestIntact = Int(ChirpAtomicLoadAcquire(written)) + maxBufferFrames - capacity
+        if (oldestIntact > drained) {
+            let torn = min(oldestIntact, end) - drained
+            memset(samples + gap, 0, torn * MemoryLayout<Int16>.size)
+            gap += torn
+        }
+        droppedSamples += gap
+        drained = end
+
+        let bytes: DispatchData
+        if (compressRecording) {
+            var data = Data(capacity: count * MemoryLayout<Int16>.size)
+            var previous = lastRecordedSample
+            for i in 0..<count {
+                ChirpFlightRecorder.appendCompressed(samples[i], previous: &previous, into: &data)
+            }
+            lastRecordedSample = previous
+            free(samples)
+            let size = data.count
+            bytes = data.withUnsafeBytes { DispatchData(bytes: UnsafeBufferPointer(start: $0, count: size)) }
+        } else {
+            let raw = UnsafeRawPointer(samples).assumingMemoryBound(to: UInt8.self)
+            bytes = DispatchData(bytesNoCopy: UnsafeBufferPointer(start: raw, count: count * MemoryLayout<Int16>.size), deallocator: .free)
+        }
+
+        let size = bytes.count
+        writesInFlight += 1
+        channel.write(offset: recordOffset, data: bytes, queue: dumpQueue) { (done, remaining, error) in
+            if (done) {
+                self.writesInFlight -= 1
+                self.completedBytes += size - (remaining?.count ?? 0)
+            }
+        }
+        recordOffset += off_t(size)
+    }
+
+    // Zigzag-encodes the delta from `previous` so small steps either way
+    // stay small, then emits it as a little-endian base-128 varint.
+    static func appendCompressed(_ sample: Int16, previous: inout Int16, into data: inout Data) {
+        let delta = Int32(sample) - Int32(previous)
+        var zigzag = UInt32(bitPattern: (delta << 1) ^ (delta >> 31))
+        while (zigzag >= 0x80) {
+            data.append(UInt8(truncatingBitPattern: zigzag) | 0x80)
+            zigzag >>= 7
+        }
+        data.append(UInt8(zigzag))
+        previous = sample
+    }
+
+    // Reads back a recording made with or without compressRecording.
+    static func decodeRecording(_ data: Data, compressed: Bool) -> [Int16] {
+        var samples: [Int16] = []
+        if (!compressed) {
+            samples = [Int16](repeating: 0, count: data.count / MemoryLayout<Int16>.size)
+            _ = samples.withUnsafeMutableBufferPointer { data.copyBytes(to: $0) }
+            return samples
+        }
+
+        var previous: Int32 = 0
+        var zigzag: UInt32 = 0
+        var shift: UInt32 = 0
+        for byte in data {
+            zigzag |= UInt32(byte & 0x7f) << shift
+            if (byte & 0x80 != 0) {
+                shift += 7
+                continue
+            }
+            let delta = Int32(bitPattern: zigzag >> 1) ^ -Int32(bitPattern: zigzag & 1)
+            previous += delta
+            samples.append(Int16(truncatingBitPattern: previous))
+            zigzag = 0
+            shift = 0
+        }
+        return samples
+    }
+
+    // MARK: Benchmark
+
+    private struct BenchmarkRun {
+        let speedup: Double
+        let bytesPerSecond: Double
+        let droppedSamples: Int
+        let appendNs: Double
+    }
+
+    // Finds the recorder's headroom: feeds a synthetic tone through append()
+    // for `seconds` at 16x real time, then doubles the rate until samples
+    // are dropped, the feed thread itself cannot keep up, or maxSpeedup is
+    // reached. Reports the highest rate with no drops, the MB/s completed at
+    // that rate and the mean append() cost. Runs are sequential, each with
+    // its own temporary file. `completion` runs on a background queue.
+    static func benchmarkRecording(seconds: TimeInterval, compress: Bool, maxSpeedup: Double = 4096, completion: @escaping (String) -> Void) {
+        func report(_ best: BenchmarkRun?, limit: String) {
+            completion(String(format: "{\"benchmark\": \"recording\", \"compress\": %@, \"max_speedup\": %.1f, \"mb_per_s\": %.2f, \"append_ns\": %.1f, \"limited_by\": \"%@\"}",
+                              compress ? "true" : "false", best?.speedup ?? 0, (best?.bytesPerSecond ?? 0) / 1e6, best?.appendNs ?? 0, limit))
+        }
+        func step(_ speedup: Double, best: BenchmarkRun?) {
+            benchmarkRun(seconds: seconds, speedup: speedup, compress: compress) { (run) in
+                if (run.droppedSamples > 0) {
+                    report(best, limit: "drops")
+                } else if (run.speedup < speedup * 0.9) {
+                    report(run, limit: "feed")
+                } else if (speedup * 2 > maxSpeedup) {
+                    report(run, limit: "max_speedup")
+                } else {
+                    step(speedup * 2, best: run)
+                }
+            }
+        }
+        step(16, best: nil)
+    }
+
+    // One paced run; `speedup` in the result is the rate actually achieved.
+    private static func benchmarkRun(seconds: TimeInterval, speedup: Double, compress: Bool, completion: @escaping (BenchmarkRun) -> Void) {
+        let sampleRate = 48000.0
+        let frames = 256
+        let recorder = ChirpFlightRecorder(seconds: 10, sampleRate: sampleRate)
+        recorder.compressRecording = compress
+        recorder.drainInterval = 0.05
+
+        let url = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("chirp-record-benchmark-\(UUID().uuidString).pcm")
+        recorder.startRecording(to: url)
+
+        DispatchQueue.global(qos: .userInitiated).async {
+            let samples = UnsafeMutablePointer<Float>.allocate(capacity: frames)
+            var buffer = AudioBuffer(mNumberChannels: 1, mDataByteSize: UInt32(frames * MemoryLayout<Float>.size), mData: UnsafeMutableRawPointer(samples))
+            let bufferPeriod = Double(frames) / sampleRate / speedup
+            let start = ProcessInfo.processInfo.systemUptime
+            var sent = 0
+
+            while (ProcessInfo.processInfo.systemUptime - start < seconds) {
+                for i in 0..<frames {
+                    samples[i] = 0.5 * sinf(Float(sent + i) * 2 * Float.pi * 1000 / Float(sampleRate))
+                }
+                recorder.append(&buffer, numFrames: UInt32(frames))
+                sent += frames
+
+                let due = start + Double(sent / frames) * bufferPeriod
+                let wait = due - ProcessInfo.processInfo.systemUptime
+                if (wait > 0) {
+                    usleep(useconds_t(wait * 1_000_000))
+                }
+            }
+            let achieved = Double(sent) / sampleRate / (ProcessInfo.processInfo.systemUptime - start)
+            samples.deallocate(capacity: frames)
+
+            recorder.stopRecording {
+                DispatchQueue.global(qos: .utility).async {
+                    let stats = recorder.recordingStats()
+                    try? FileManager.default.removeItem(at: url)
+                    completion(BenchmarkRun(speedup: achieved, bytesPerSecond: stats.bytesPerSecond, droppedSamples: stats.droppedSamples, appendNs: recorder.averageAppendCost()))
+                }
+            }
+        }
+    }
+
+    // 16-bit mono PCM.
+    func wav(samples: [Int16]) -> Data {
+        let dataSize = UInt32(samples.count * MemoryLayout<Int16>.size)
+        var data = Data()
+
+        func appendTag(_ tag: String) {
+            data.append(tag.data(using: .ascii)!)
+        }
+        func appendValue<T>(_ value: T) {
+            var value = value
+            data.append(UnsafeBufferPointer(start: &value, count: 1))
+        }
+
+        appendTag("RIFF")
+        appendValue(UInt32(36) + dataSize)
+        appendTag("WAVE")
+        appendTag("fmt ")
+        appendValue(UInt32(16))
+        appendValue(UInt16(1))
+        appendValue(UInt16(1))
+        appendValue(UInt32(sampleRate))
+        appendValue(UInt32(sampleRate) * 2)
+        appendValue(UInt16(2))
+        appendValue(UInt16(16))
+        appendTag("data")
+        appendValue(dataSize)
+        samples.withUnsafeBufferPointer { data.append($0) }
+        return data
+    }
+}
@@ -0,0 +1,164 @@
+//
+//  ChirpFlightRecorderTests.swift
+//  ChirpGemSwapTests
+//
+//  The recorder sources are compiled into this bundle directly, so these
+//  tests need no host app and never start the audio engine.
+//
+
+import XCTest
+import AudioToolbox
+
+class ChirpFlightRecorderTests: XCTestCase {
+
+    // Appends `samples` as int16 audio buffers of at most 256 frames.
+    func append(_ samples: [Int16], channels: Int = 1, to recorder: ChirpFlightRecorder) {
+        var samples = samples
+        let chunk = 256 * channels
+        samples.withUnsafeMutableBufferPointer { (pointer) in
+            var offset = 0
+            while (offset < pointer.count) {
+                let count = min(chunk, pointer.count - offset)
+                var buffer = AudioBuffer(mNumberChannels: UInt32(channels), mDataByteSize: UInt32(count * MemoryLayout<Int16>.size), mData: UnsafeMutableRawPointer(pointer.baseAddress! + offset))
+                recorder.append(&buffer, numFrames: UInt32(count / channels))
+                offset += count
+            }
+        }
+    }
+
+    func readUInt32(_ data: Data, at offset: Int) -> UInt32 {
+        return data.subdata(in: offset..<offset + 4).withUnsafeBytes { (pointer: UnsafePointer<UInt32>) in pointer.pointee }
+    }
+
+    func readUInt16(_ data: Data, at offset: Int) -> UInt16 {
+        return data.subdata(in: offset..<offset + 2).withUnsafeBytes { (pointer: UnsafePointer<UInt16>) in pointer.pointee }
+    }
+
+    // Records `samples` through the ring with only the final drain on stop,
+    // and returns the file decoded along with the samples counted as lost.
+    func record(_ samples: [Int16], seconds: Double, compressed: Bool) -> (samples: [Int16], dropped: Int) {
+        let recorder = ChirpFlightRecorder(seconds: seconds, sampleRate: 8000)
+        recorder.compressRecording = compressed
+        recorder.drainInterval = 3600
+        let url = URL(fileURLWithPath: NSTemporaryDirectory()).appendingPathComponent("chirp-record-test-\(UUID().uuidString).pcm")
+        defer {
+            try? FileManager.default.removeItem(at: url)
+        }
+
+        recorder.startRecording(to: url)
+        // Runs on the recorder's queue, so recording has started once it returns.
+        _ = recorder.recordingStats()
+        append(samples, to: recorder)
+        let stopped = expectation(description: "recording stopped")
+        recorder.stopRecording {
+            stopped.fulfill()
+        }
+        waitForExpectations(timeout: 5, handler: nil)
+
+        let data = (try? Data(contentsOf: url)) ?? Data()
+        return (ChirpFlightRecorder.decodeRecording(data, compressed: compressed), recorder.recordingStats().droppedSamples)
+    }
+
+    // A tone with full-scale steps mixed in, so the varints need every length.
+    func testSignal(count: Int) -> [Int16] {
+        return (0..<count).map { (i) -> Int16 in
+            if (i % 500 == 0) {
+                return (i % 1000 == 0) ? Int16.min : Int16.max
+            }
+            return Int16(8000 * sin(Double(i) * 2 * Double.pi * 440 / 8000))
+        }
+    }
+
+    // MARK: Ring
+
+    func testCopyRingBeforeWrap() {
+        let recorder = ChirpFlightRecorder(seconds: 1, sampleRate: 1000)
+        let samples = (0..<300).map { Int16($0) }
+        append(samples, to: recorder)
+
+        XCTAssertEqual(recorder.copyRing(end: samples.count), samples)
+    }
+
+    func testCopyRingAfterWrap() {
+        let recorder = ChirpFlightRecorder(seconds: 1, sampleRate: 1000)
+        let samples = (0..<2500).map { Int16($0) }
+        append(samples, to: recorder)
+
+        let copy = recorder.copyRing(end: samples.count)
+        XCTAssertEqual(copy.count, recorder.capacity)
+        XCTAssertEqual(copy, Array(samples.suffix(recorder.capacity)))
+    }
+
+    func testStereoIsDownmixed() {
+        let recorder = ChirpFlightRecorder(seconds: 1, sampleRate: 1000)
+        append([100, 300, -100, -300, 0, 10], channels: 2, to: recorder)
+
+        XCTAssertEqual(recorder.copyRing(end: 3), [200, -200, 5])
+    }
+
+    // MARK: WAV
+
+    func testWavHeader() {
+        let recorder = ChirpFlightRecorder(seconds: 1, sampleRate: 8000)
+        let wav = recorder.wav(samples: [1, -1, 3])
+
+        XCTAssertEqual(wav.count, 44 + 6)
+        XCTAssertEqual(String(data: wav.subdata(in: 0..<4), encoding: .ascii), "RIFF")
+        XCTAssertEqual(readUInt32(wav, at: 4), 36 + 6)
+        XCTAssertEqual(String(data: wav.subdata(in: 8..<16), encoding: .ascii), "WAVEfmt ")
+        XCTAssertEqual(readUInt32(wav, at: 16), 16)
+        XCTAssertEqual(readUInt16(wav, at: 20), 1)
+        XCTAssertEqual(readUInt16(wav, at: 22), 1)
+        XCTAssertEqual(readUInt32(wav, at: 24), 8000)
+        XCTAssertEqual(readUInt32(wav, at: 28), 16000)
+        XCTAssertEqual(readUInt16(wav, at: 32), 2)
+        XCTAssertEqual(readUInt16(wav, at: 34), 16)
+        XCTAssertEqual(String(data: wav.subdata(in: 36..<40), encoding: .ascii), "data")
+        XCTAssertEqual(readUInt32(wav, at: 40), 6)
+        XCTAssertEqual(ChirpFlightRecorder.decodeRecording(wav.subdata(in: 44..<50), compressed: false), [1, -1, 3])
+    }
+
+    // MARK: Recording
+
+    func testCompressedEncoding() {
+        var data = Data()
+        var previous: Int16 = 0
+        for sample: Int16 in [1, 0, -64, 0, Int16.max, Int16.min] {
+            ChirpFlightRecorder.appendCompressed(sample, previous: &previous, into: &data)
+        }
+
+        // Deltas 1, -1, -64, 64, 32767, -65535 zigzag to 2, 1, 127, 128,
+        // 65534 and 131069.
+        XCTAssertEqual([UInt8](data), [0x02, 0x01, 0x7f, 0x80, 0x01, 0xfe, 0xff, 0x03, 0xfd, 0xff, 0x07])
+        XCTAssertEqual(previous, Int16.min)
+        XCTAssertEqual(ChirpFlightRecorder.decodeRecording(data, compressed: true), [1, 0, -64, 0, Int16.max, Int16.min])
+    }
+
+    func testRawRecordingRoundTrip() {
+        let samples = testSignal(count: 10000)
+        let recorded = record(samples, seconds: 2, compressed: false)
+
+        XCTAssertEqual(recorded.dropped, 0)
+        XCTAssertEqual(recorded.samples, samples)
+    }
+
+    func testCompressedRecordingRoundTrip() {
+        let samples = testSignal(count: 10000)
+        let recorded = record(samples, seconds: 2, compressed: true)
+
+        XCTAssertEqual(recorded.dropped, 0)
+        XCTAssertEqual(recorded.samples, samples)
+    }
+
+    func testOverrunIsRecordedAsSilence() {
+        let samples = testSignal(count: 20000)
+        for compressed in [false, true] {
+            let recorded = record(samples, seconds: 1, compressed: compressed)
+
+            XCTAssertGreaterThanOrEqual(recorded.dropped, samples.count - 8000)
+            XCTAssertEqual(recorded.samples.count, samples.count)
+            XCTAssertEqual(Array(recorded.samples.prefix(recorded.dropped)), [Int16](repeating: 0, count: recorded.dropped))
+            XCTAssertEqual(Array(recorded.samples.suffix(samples.count - recorded.dropped)), Array(samples.suffix(samples.count - recorded.dropped)))
+        }
+    }
+}
@@ -12,6 +12,9 @@
 
 #import <XCTest/XCTest.h>
 #import <ChirpSDK/ChirpSDK.h>
+#import <mach/mach_time.h>
+
+#define BENCHMARK_ITERATIONS  1000
 
 
 @interface Gem_SwapTests : XCTestCase
@@ -25,4 +28,154 @@
     XCTAssertNotNil([[ChirpSDK sdk] version]);
 }
 
+#pragma mark - Benchmarks
+
+/*----------------------------------------------------------------------------*
+ * Select a protocol for benchmarking. The engine must be stopped first,
+ * otherwise setProtocolNamed: fails with
+ * ChirpErrorCannotSetProtocolWhenEngineRunning.
+ *
+ * The tests do not authenticate, and non-standard protocols need app
+ * permission, so a permissions error skips the benchmark rather than
+ * failing it. Returns NO if the protocol could not be selected.
+ *----------------------------------------------------------------------------*/
+- (BOOL)selectProtocol:(NSString *)protocolName
+{
+    [[ChirpSDK sdk] stop];
+    NSError *error = [[ChirpSDK sdk] setProtocolNamed:protocolName];
+    if (error.code == ChirpErrorInsufficientPermissions)
+    {
+        NSLog(@"Skipping %@ benchmarks: %@", protocolName, error.localizedDescription);
+        return NO;
+    }
+    XCTAssertNil(error);
+    return error == nil;
+}
+
+/*----------------------------------------------------------------------------*
+ * Run `block` BENCHMARK_ITERATIONS times and log one JSON line per run, so
+ * that results can be collected from the test log and diffed between runs.
+ *----------------------------------------------------------------------------*/
+- (void)benchmark:(NSString *)name
+         protocol:(NSString *)protocolName
+            block:(void (^)(void))block
+{
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info(&timebase);
+
+    uint64_t start = mach_absolute_time();
+    for (NSUInteger i = 0; i < BENCHMARK_ITERATIONS; i++)
+    {
+        block();
+    }
+    uint64_t elapsed = mach_absolute_time() - start;
+
+    double nsPerOp = (double) elapsed * timebase.numer / timebase.denom / BENCHMARK_ITERATIONS;
+    NSLog(@"{\"benchmark\": \"%@\", \"protocol\": \"%@\", \"iterations\": %d, \"ns_per_op\": %.1f}",
+          name, protocolName, BENCHMARK_ITERATIONS, nsPerOp);
+}
+
+- (void)benchmarkProtocol:(NSString *)protocolName
+{
+    ChirpSDK *sdk = [ChirpSDK sdk];
+    if (![self selectProtocol:protocolName]) return;
+
+    [self benchmark:@"randomIdentifier" protocol:protocolName block:^{
+        (void) [sdk randomIdentifier];
+    }];
+
+    NSString *identifier = [sdk randomIdentifier];
+    XCTAssertNotNil(identifier);
+    XCTAssertTrue([sdk isValidChirpIdentifier:identifier]);
+    [self benchmark:@"isValidChirpIdentifier" protocol:protocolName block:^{
+        (void) [sdk isValidChirpIdentifier:identifier];
+    }];
+
+    /*----------------------------------------------------------------------------*
+     * encodedIdentifier appends the Reed-Solomon parity symbols, so this
+     * covers the error-correction encoder as exposed by the public API.
+     * Check once up front that encoding works, or the loop times nothing.
+     *----------------------------------------------------------------------------*/
+    Chirp *chirp = [[Chirp alloc] initWithIdentifier:identifier];
+    XCTAssertNotNil(chirp);
+    XCTAssertNotNil(chirp.encodedIdentifier);
+    if (!chirp.encodedIdentifier) return;
+
+    [self benchmark:@"encode" protocol:protocolName block:^{
+        Chirp *chirp = [[Chirp alloc] initWithIdentifier:identifier];
+        (void) chirp.encodedIdentifier;
+    }];
+
+    NSArray *array = [sdk randomChirpArray];
+    XCTAssertNotNil([[Chirp alloc] initWithArray:array]);
+    [self benchmark:@"initWithArray" protocol:protocolName block:^{
+        (void) [[Chirp alloc] initWithArray:array];
+    }];
+}
+
+- (void)testBenchmarkStandard
+{
+    [self benchmarkProtocol:ChirpProtocolNameStandard];
+}
+
+- (void)testBenchmarkUltrasonic
+{
+    [self benchmarkProtocol:ChirpProtocolNameUltrasonic];
+}
+
+- (void)testPerformanceEncode
+{
+    if (![self selectProtocol:ChirpProtocolNameStandard]) return;
+    NSString *identifier = [[ChirpSDK sdk] randomIdentifier];
+    XCTAssertNotNil(identifier);
+    XCTAssertNotNil([[Chirp alloc] initWithIdentifier:identifier].encodedIdentifier);
+
+    [self measureBlock:^{
+        for (NSUInteger i = 0; i < BENCHMARK_ITERATIONS; i++)
+        {
+            Chirp *chirp = [[Chirp alloc] initWithIdentifier:identifier];
+            (void) chirp.encodedIdentifier;
+        }
+    }];
+}
+
+- (void)expectReady
+{
+    [self expectationForNotification:ChirpNotificationAudioStateChanged
+                              object:nil
+                             handler:^BOOL(NSNotification *notification) {
+        NSNumber *state = notification.userInfo[ChirpNotificationAudioStateKey];
+        return state.intValue == ChirpAudioStateReady;
+    }];
+}
+
+/*----------------------------------------------------------------------------*
+ * start returns before the audio device is running, so each sample times
+ * start up to the ChirpAudioStateReady notification. The first start is
+ * waited for outside the measurement so that its Ready cannot satisfy the
+ * first sample's expectation.
+ *----------------------------------------------------------------------------*/
+- (void)testPerformanceWarmStart
+{
+    ChirpSDK *sdk = [ChirpSDK sdk];
+    if (sdk.audioEngineState != ChirpAudioStateReady)
+    {
+        [self expectReady];
+        [sdk start];
+        [self waitForExpectationsWithTimeout:5.0 handler:nil];
+    }
+
+    [self measureMetrics:[[self class] defaultPerformanceMetrics]
+    automaticallyStartMeasuring:NO
+                        forBlock:^{
+        [sdk stop];
+        [self expectReady];
+
+        [self startMeasuring];
+        [sdk start];
+        [self waitForExpectationsWithTimeout:5.0 handler:nil];
+        [self stopMeasuring];
+    }];
+}
+
 @end
@@ -0,0 +1,92 @@
+//
+//  ChirpStatsTests.swift
+//  ChirpGemSwapTests
+//
+
+import XCTest
+
+class ChirpStatsTests: XCTestCase {
+    let stats = ChirpStats.shared
+
+    override func setUp() {
+        super.setUp()
+        stats.reset()
+    }
+
+    override func tearDown() {
+        stats.duplicateWindow = 5.0
+        stats.reset()
+        super.tearDown()
+    }
+
+    func post(_ name: String, times: Int = 1) {
+        for _ in 0..<times {
+            NotificationCenter.default.post(name: Notification.Name(rawValue: name), object: nil)
+        }
+    }
+
+    func makeChirp() -> Chirp {
+        let chirp = Chirp(identifier: ChirpSDK.sharedSDK().randomIdentifier())
+        XCTAssertNotNil(chirp)
+        return chirp!
+    }
+
+    func testActiveReceptions() {
+        post(ChirpNotificationAudioHearStarted, times: 3)
+        post(ChirpNotificationAudioHearComplete)
+        post(ChirpNotificationAudioHearFailed)
+
+        var snapshot = stats.snapshot()
+        XCTAssertEqual(snapshot.hearStarted, 3)
+        XCTAssertEqual(snapshot.hearComplete, 1)
+        XCTAssertEqual(snapshot.hearFailed, 1)
+        XCTAssertEqual(snapshot.activeReceptions, 1)
+
+        // Never negative, even if completions outnumber starts.
+        post(ChirpNotificationAudioHearComplete, times: 2)
+        snapshot = stats.snapshot()
+        XCTAssertEqual(snapshot.activeReceptions, 0)
+    }
+
+    func testErrorsAreCounted() {
+        stats.recordHeard(nil, error: NSError(domain: "test", code: ChirpError.decodeFailed.rawValue, userInfo: nil))
+        stats.recordHeard(nil, error: NSError(domain: "test", code: ChirpError.networkError.rawValue, userInfo: nil))
+        stats.recordHeard(nil, error: nil)
+
+        let snapshot = stats.snapshot()
+        XCTAssertEqual(snapshot.decodeFailures, 1)
+        XCTAssertEqual(snapshot.otherErrors, 2)
+        XCTAssertEqual(snapshot.chirpsHeard, 0)
+    }
+
+    func testDuplicatesAreCounted() {
+        let chirp = makeChirp()
+        let other = makeChirp()
+
+        XCTAssertFalse(stats.recordHeard(chirp, error: nil))
+        XCTAssertTrue(stats.recordHeard(chirp, error: nil))
+        XCTAssertFalse(stats.recordHeard(other, error: nil))
+        XCTAssertFalse(stats.recordHeard(chirp, error: nil))
+
+        let snapshot = stats.snapshot()
+        XCTAssertEqual(snapshot.chirpsHeard, 3)
+        XCTAssertEqual(snapshot.duplicatesHeard, 1)
+    }
+
+    // A repeat does not extend the window, so an identifier repeated more
+    // often than the window is still counted as heard once per window.
+    func testDuplicateWindowIsAnchoredToFirstHit() {
+        let chirp = makeChirp()
+        stats.duplicateWindow = 0.2
+
+        XCTAssertFalse(stats.recordHeard(chirp, error: nil))
+        Thread.sleep(forTimeInterval: 0.15)
+        XCTAssertTrue(stats.recordHeard(chirp, error: nil))
+        Thread.sleep(forTimeInterval: 0.1)
+        XCTAssertFalse(stats.recordHeard(chirp, error: nil))
+
+        let snapshot = stats.snapshot()
+        XCTAssertEqual(snapshot.chirpsHeard, 2)
+        XCTAssertEqual(snapshot.duplicatesHeard, 1)
+    }
+}
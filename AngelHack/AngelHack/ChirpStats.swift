@@ -0,0 +1,132 @@
+//
+//  ChirpStats.swift
+//  AngelHack
+//
+//  Cumulative receive counters, fed from the Chirp SDK's hear notifications
+//  and the chirp heard block, plus timings for SDK phases such as startup
+//  and protocol switches.
+//
+
+import Foundation
+
+struct ChirpStatsSnapshot {
+    var hearStarted: UInt64 = 0
+    var hearComplete: UInt64 = 0
+    var hearFailed: UInt64 = 0
+    var chirpsHeard: UInt64 = 0
+    var decodeFailures: UInt64 = 0
+    var otherErrors: UInt64 = 0
+    var duplicatesHeard: UInt64 = 0
+
+    // Receptions the engine has started but not yet completed or failed.
+    var activeReceptions: UInt64 {
+        let finished = hearComplete + hearFailed
+        return hearStarted > finished ? hearStarted - finished : 0
+    }
+}
+
+class ChirpStats {
+    static let shared = ChirpStats()
+
+    // The same identifier heard again within this window of its first hit
+    // counts as a duplicate. The window is fixed rather than sliding, so an
+    // identifier repeated every few seconds is counted afresh each window.
+    var duplicateWindow: TimeInterval = 5.0
+
+    private let queue = DispatchQueue(label: "io.chirp.angelhack.stats")
+    private var counters = ChirpStatsSnapshot()
+    private var lastIdentifier: String?
+    private var firstHeardAt = Date.distantPast
+    private var phaseStarts: [String: TimeInterval] = [:]
+    private var phases: [(name: String, duration: TimeInterval)] = []
+    private var observers: [NSObjectProtocol] = []
+
+    private init() {
+        observe(ChirpNotificationAudioHearStarted) { $0.hearStarted += 1 }
+        observe(ChirpNotificationAudioHearComplete) { $0.hearComplete += 1 }
+        observe(ChirpNotificationAudioHearFailed) { $0.hearFailed += 1 }
+    }
+
+    deinit {
+        for observer in observers {
+            NotificationCenter.default.removeObserver(observer)
+        }
+    }
+
+    private func observe(_ name: String, update: @escaping (inout ChirpStatsSnapshot) -> Void) {
+        let observer = NotificationCenter.default.addObserver(forName: Notification.Name(rawValue: name), object: nil, queue: nil) { [unowned self] _ in
+            self.queue.async { update(&self.counters) }
+        }
+        observers.append(observer)
+    }
+
+    // Call from the chirp heard block. Duplicates are only counted; the
+    // caller still handles every chirp. Returns true for a duplicate.
+    @discardableResult
+    func recordHeard(_ chirp: Chirp?, error: Error?) -> Bool {
+        return queue.sync { () -> Bool in
+            if let error = error as NSError? {
+                if error.code == ChirpError.decodeFailed.rawValue {
+                    counters.decodeFailures += 1
+                } else {
+                    counters.otherErrors += 1
+                }
+                return false
+            }
+            guard let identifier = chirp?.identifier else {
+                counters.otherErrors += 1
+                return false
+            }
+
+            let now = Date()
+            if identifier == lastIdentifier && now.timeIntervalSince(firstHeardAt) < duplicateWindow {
+                counters.duplicatesHeard += 1
+                return true
+            }
+            counters.chirpsHeard += 1
+            lastIdentifier = identifier
+            firstHeardAt = now
+            return false
+        }
+    }
+
+    func snapshot() -> ChirpStatsSnapshot {
+        return queue.sync { counters }
+    }
+
+    func reset() {
+        queue.sync {
+            counters = ChirpStatsSnapshot()
+            lastIdentifier = nil
+            firstHeardAt = Date.distantPast
+            phaseStarts = [:]
+            phases = []
+        }
+    }
+
+    // MARK: Phases
+
+    func beginPhase(_ name: String) {
+        let now = ProcessInfo.processInfo.systemUptime
+        queue.sync { phaseStarts[name] = now }
+    }
+
+    // Ending a phase that was never begun, or has already ended, is a no-op
+    // and returns false.
+    @discardableResult
+    func endPhase(_ name: String) -> Bool {
+        let now = ProcessInfo.processInfo.systemUptime
+        return queue.sync { () -> Bool in
+            guard let start = phaseStarts.removeValue(forKey: name) else {
+                return false
+            }
+            phases.append((name: name, duration: now - start))
+            return true
+        }
+    }
+
+    // Completed phases in the order they finished, durations in seconds.
+    func completedPhases() -> [(name: String, duration: TimeInterval)] {
+        return queue.sync { phases }
+    }
+}
@@ -0,0 +1,134 @@
+//
+//  ChirpTrace.swift
+//  AngelHack
+//
+//  Per-chirp trace spans from the start of reception to the associated data
+//  being shown, exported in the Chrome trace event format (chrome://tracing,
+//  Perfetto).
+//
+
+import Foundation
+
+struct ChirpTraceSpan {
+    let name: String
+    let trace: Int
+    let start: TimeInterval
+}
+
+class ChirpTrace {
+    static let shared = ChirpTrace()
+
+    // Only the most recent events are kept.
+    let maxEvents = 1024
+
+    private let queue = DispatchQueue(label: "io.chirp.angelhack.trace")
+    private var events: [[String: Any]] = []
+    private var nextEvent = 0
+    private var currentTrace = 0
+    private var receiving: ChirpTraceSpan?
+    private var dispatching: ChirpTraceSpan?
+    private var observers: [NSObjectProtocol] = []
+
+    private init() {
+        observe(ChirpNotificationAudioHearStarted) { (now) in
+            // A dispatch span left open means the heard block ran before
+            // hear.complete was recorded; drop it rather than let the next
+            // chirp's callback close it.
+            self.dispatching = nil
+            self.currentTrace += 1
+            self.receiving = ChirpTraceSpan(name: "receive", trace: self.currentTrace, start: now)
+        }
+        observe(ChirpNotificationAudioHearComplete) { (now) in
+            self.finishReceive(at: now)
+            self.dispatching = ChirpTraceSpan(name: "heard callback", trace: self.currentTrace, start: now)
+        }
+        observe(ChirpNotificationAudioHearFailed) { (now) in
+            self.finishReceive(at: now)
+        }
+    }
+
+    deinit {
+        for observer in observers {
+            NotificationCenter.default.removeObserver(observer)
+        }
+    }
+
+    // The timestamp is taken on the posting thread, which may belong to the
+    // SDK; the recording itself is queued so that thread never blocks.
+    private func observe(_ name: String, handler: @escaping (TimeInterval) -> Void) {
+        let observer = NotificationCenter.default.addObserver(forName: Notification.Name(rawValue: name), object: nil, queue: nil) { [unowned self] _ in
+            let now = ProcessInfo.processInfo.systemUptime
+            self.queue.async { handler(now) }
+        }
+        observers.append(observer)
+    }
+
+    private func makeSpan(_ name: String, trace: Int) -> ChirpTraceSpan {
+        return ChirpTraceSpan(name: name, trace: trace, start: ProcessInfo.processInfo.systemUptime)
+    }
+
+    private func finishReceive(at end: TimeInterval) {
+        if let span = receiving {
+            record(span, end: end)
+            receiving = nil
+        }
+    }
+
+    private func record(_ span: ChirpTraceSpan, end: TimeInterval) {
+        let event: [String: Any] = [
+            "name": span.name,
+            "ph": "X",
+            "pid": 1,
+            "tid": span.trace,
+            "ts": span.start * 1_000_000,
+            "dur": (end - span.start) * 1_000_000,
+        ]
+        if (events.count < maxEvents) {
+            events.append(event)
+        } else {
+            events[nextEvent] = event
+        }
+        nextEvent = (nextEvent + 1) % maxEvents
+    }
+
+    // Call first thing in the chirp heard block. Closes the span between
+    // the SDK completing a decode and the block running, and returns the
+    // trace id for the spans that follow. If the SDK calls the block before
+    // hear.complete has been recorded there is no span to close, and that
+    // chirp has no dispatch span.
+    func heardCallback() -> Int {
+        let now = ProcessInfo.processInfo.systemUptime
+        return queue.sync { () -> Int in
+            if let span = dispatching, span.trace == currentTrace {
+                record(span, end: now)
+                dispatching = nil
+            }
+            return currentTrace
+        }
+    }
+
+    func begin(_ name: String, trace: Int) -> ChirpTraceSpan {
+        return makeSpan(name, trace: trace)
+    }
+
+    func end(_ span: ChirpTraceSpan) {
+        let now = ProcessInfo.processInfo.systemUptime
+        queue.async { self.record(span, end: now) }
+    }
+
+    func exportJSON() -> Data? {
+        let events = queue.sync { self.events }
+        return try? JSONSerialization.data(withJSONObject: ["traceEvents": events], options: [])
+    }
+
+    // Writes the trace to Documents/chirp-trace.json.
+    func save() {
+        DispatchQueue.global(qos: .utility).async {
+            guard let data = self.exportJSON(),
+                  let documents = FileManager.default.urls(for: .documentDirectory, in: .userDomainMask).first else {
+                return
+            }
+            try? data.write(to: documents.appendingPathComponent("chirp-trace.json"))
+        }
+    }
+}
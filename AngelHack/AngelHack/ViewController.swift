@@ -9,9 +9,12 @@
 import UIKit
 
 class ViewController: UIViewController {
-    let myChirp = ChirpSDK();
+    let myChirp = ChirpSDK.sharedSDK()
     let chirp = Chirp()
     var err: NSError = NSError()
+    var recorder: ChirpFlightRecorder?
+    var protocolName = ChirpProtocolNameStandard
+    var switchingProtocol = false
     @IBOutlet var textArea: UITextView!
    // let alert = AudioAlertPlayer()
     override func viewDidLoad() {
@@ -19,7 +22,11 @@ class ViewController: UIViewController {
         let isOk: Bool
       
     //   myChirp.setAppKey("mrepHsIsKKoGANMk3Gb5FkvPO", andSecret: "mgb84LV1s6VEKtJdAlGL3rcjpkIa4WA9OSbSfqxWsYclhiDXOC")
+        let stats = ChirpStats.shared
+        _ = ChirpTrace.shared
+        stats.beginPhase("auth")
         myChirp.setAppKey("mrepHsIsKKoGANMk3Gb5FkvPO", andSecret: "mgb84LV1s6VEKtJdAlGL3rcjpkIa4WA9OSbSfqxWsYclhiDXOC") { ( isOk, error) in
+            stats.endPhase("auth")
             if(error != nil)
             {print(error)}
             else if (isOk)
@@ -32,9 +39,32 @@ class ViewController: UIViewController {
         
         //myChirp.setProtocolNamed(ChirpProtocolNameUltrasonic)
         
-        myChirp.setProtocolNamed(ChirpProtocolNameStandard)
+        stats.beginPhase("protocol load")
+        myChirp.setProtocolNamed(protocolName)
+        stats.endPhase("protocol load")
+
+        // start() returns before the audio device is running; the engine
+        // reports Ready once it is.
+        myChirp.setAudioStateChangedBlock { (state) in
+            // Ready follows every chirp played or heard; only the first one
+            // after start ends the phase.
+            if (state == ChirpAudioStateReady) {
+                if (stats.endPhase("device open") || stats.endPhase("protocol switch")) {
+                    print(stats.completedPhases())
+                }
+                DispatchQueue.main.async {
+                    self.startRecorder()
+                }
+            }
+        }
+        stats.beginPhase("start")
+        stats.beginPhase("device open")
         myChirp.start()
-        _ = Timer.scheduledTimer(timeInterval: 0.5, target: self, selector: #selector(ViewController.sayHello), userInfo: nil, repeats: true)
+        stats.endPhase("start")
+        sayHello()
+
+        let longPress = UILongPressGestureRecognizer(target: self, action: #selector(ViewController.toggleProtocol(_:)))
+        textArea.addGestureRecognizer(longPress)
         
         //myChirp.volume = 0.5;
        
@@ -42,34 +72,12 @@ class ViewController: UIViewController {
         // Do any additional setup after loading the view, typically from a nib.
     }
     
+    // Installs the heard handler. Anything that replaces the heard block
+    // should call this rather than installing its own, so that associated
+    // data, stats, traces and flight recorder dumps keep working.
     func sayHello(){
         myChirp.setChirpHeardBlock { (birdy, error) in
-            if(birdy == nil) {
-                print ("you are a useless piece of shit")
-            }
-            else {
-                print ("praise the lord")
-                birdy?.fetchAssociatedData(completion: { (birdy, error) in
-                    if (birdy != nil){
-                        print("Raam Raam Raam Raam Raam")
-                       // let data: NSDictionary = birdy?.data as! NSDictionary
-                        let returnData = birdy?.data as! NSDictionary as! [String: AnyObject] as! [String : NSObject]
-                        
-                        print (returnData)
-                        let dumdum = String(describing: returnData)
- 
-                        //let text: NSString = NSString(data: data, encoding: String.Encoding.utf8)
-                        print("Bismillah")
-                        print("Subhanallah")
-                        print("Mashallah")
-                       // print(data)
-                            
-                        
-                        self.textArea.text = dumdum
-                    }
-                    
-                })
-            }
+            self.chirpHeard(birdy, error: error)
         }
         
        // print ("this")
@@ -93,6 +101,147 @@ class ViewController: UIViewController {
 
     }
    
+    func chirpHeard(_ birdy: Chirp?, error: Error?) {
+        let trace = ChirpTrace.shared.heardCallback()
+        self.recorder?.recordHeard(error: error)
+        ChirpStats.shared.recordHeard(birdy, error: error)
+        if(birdy == nil) {
+            print ("you are a useless piece of shit")
+        }
+        else {
+            print ("praise the lord")
+            let fetch = ChirpTrace.shared.begin("fetchAssociatedData", trace: trace)
+            birdy?.fetchAssociatedData(completion: { (birdy, error) in
+                ChirpTrace.shared.end(fetch)
+                if (birdy != nil){
+                    print("Raam Raam Raam Raam Raam")
+                   // let data: NSDictionary = birdy?.data as! NSDictionary
+                    let returnData = birdy?.data as! NSDictionary as! [String: AnyObject] as! [String : NSObject]
+                    
+                    print (returnData)
+                    let dumdum = String(describing: returnData)
+ 
+                    //let text: NSString = NSString(data: data, encoding: String.Encoding.utf8)
+                    print("Bismillah")
+                    print("Subhanallah")
+                    print("Mashallah")
+                   // print(data)
+                        
+                    
+                    let ui = ChirpTrace.shared.begin("ui", trace: trace)
+                    DispatchQueue.main.async {
+                        self.textArea.text = dumdum
+                        ChirpTrace.shared.end(ui)
+                        ChirpTrace.shared.save()
+                    }
+                }
+                
+            })
+        }
+    }
+
+    // The flight recorder is sized from the hardware sample rate, which is
+    // only known once the engine is running, so it is created on the first
+    // Ready rather than in viewDidLoad.
+    //
+    // Continuous capture recording and its benchmark are off by default and
+    // enabled through user defaults, e.g. the launch arguments
+    // `-ChirpRecordCapture YES`, `-ChirpRecordCaptureCompressed YES` or
+    // `-ChirpRecordBenchmark YES`.
+    func startRecorder() {
+        guard recorder == nil && myChirp.sampleRate > 0 else {
+            return
+        }
+        let recorder = ChirpFlightRecorder(seconds: 10, sampleRate: Double(myChirp.sampleRate))
+        self.recorder = recorder
+        myChirp.setAudioBufferUpdatedBlock { (buffer, numFrames) in
+            recorder.append(buffer, numFrames: numFrames)
+        }
+
+        let defaults = UserDefaults.standard
+        if (defaults.bool(forKey: "ChirpRecordCapture")),
+            let documents = FileManager.default.urls(for: .documentDirectory, in: .userDomainMask).first {
+            let compressed = defaults.bool(forKey: "ChirpRecordCaptureCompressed")
+            let name = "capture-\(Int(Date().timeIntervalSince1970)).\(compressed ? "dpcm" : "pcm")"
+            recorder.compressRecording = compressed
+            recorder.startRecording(to: documents.appendingPathComponent(name))
+        }
+        if (defaults.bool(forKey: "ChirpRecordBenchmark")) {
+            // One after the other, so neither run competes with the other
+            // for CPU or disk.
+            ChirpFlightRecorder.benchmarkRecording(seconds: 2, compress: false) { (result) in
+                print(result)
+                ChirpFlightRecorder.benchmarkRecording(seconds: 2, compress: true) { (result) in
+                    print(result)
+                }
+            }
+        }
+    }
+
+    // Long-press the text view to switch between the standard and
+    // ultrasonic protocols.
+    func toggleProtocol(_ sender: UILongPressGestureRecognizer) {
+        guard sender.state == .began && !switchingProtocol else {
+            return
+        }
+        let name = (protocolName == ChirpProtocolNameStandard) ? ChirpProtocolNameUltrasonic : ChirpProtocolNameStandard
+        switchingProtocol = true
+        switchProtocol(named: name) { (error) in
+            self.switchingProtocol = false
+            if (error != nil) {
+                print(error!)
+            } else {
+                self.protocolName = name
+                self.textArea.text = "Protocol: \(name)"
+            }
+        }
+    }
+
+    // The SDK refuses to change protocol while the engine is running
+    // (ChirpErrorCannotSetProtocolWhenEngineRunning), so the engine is
+    // restarted around the change. A chirp being played or received is
+    // allowed to finish on the old protocol first; if the engine is still
+    // busy after `timeout` seconds (a stream is never finished by the SDK)
+    // the switch fails with ChirpErrorEngineBusy.
+    //
+    // The state check and stop() are not atomic: a reception that starts
+    // between them is cut off. The SDK has no way to hold off reception,
+    // so this only narrows the window.
+    //
+    // The "protocol switch" phase ends when the restarted engine reports
+    // Ready, so it includes reopening the audio device.
+    func switchProtocol(named name: String, timeout: TimeInterval = 5, completion: ((NSError?) -> Void)? = nil) {
+        switchProtocol(named: name, deadline: .now() + timeout, completion: completion)
+    }
+
+    private func switchProtocol(named name: String, deadline: DispatchTime, completion: ((NSError?) -> Void)?) {
+        let state = myChirp.audioEngineState
+        if (state == ChirpAudioStateChirping || state == ChirpAudioStateStreaming || state == ChirpAudioStateReceiving) {
+            if (DispatchTime.now() >= deadline) {
+                completion?(NSError(domain: "io.chirp.angelhack", code: ChirpError.engineBusy.rawValue, userInfo: [NSLocalizedDescriptionKey: "Engine still busy; protocol not switched"]))
+                return
+            }
+            DispatchQueue.main.asyncAfter(deadline: .now() + 0.05) {
+                self.switchProtocol(named: name, deadline: deadline, completion: completion)
+            }
+            return
+        }
+
+        let stats = ChirpStats.shared
+        stats.beginPhase("protocol switch")
+        let wasRunning = (state != ChirpAudioStateStopped)
+        if (wasRunning) {
+            myChirp.stop()
+        }
+        let error = myChirp.setProtocolNamed(name)
+        if (wasRunning) {
+            myChirp.start()
+        } else {
+            stats.endPhase("protocol switch")
+        }
+        completion?(error)
+    }
+
     override func didReceiveMemoryWarning() {
         super.didReceiveMemoryWarning()
         // Dispose of any resources that can be recreated.
@@ -112,14 +261,7 @@ class ViewController: UIViewController {
         
         let blah = Chirp(array: [9, "dumbum"])
 
-        myChirp.setChirpHeardBlock { (birdy, error) in
-            if(birdy == nil) {
-                print ("you are a useless piece of shit")
-            }
-            else {
-                print ("praise the lord")
-            }
-        }
+        sayHello()
         
         
         